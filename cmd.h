@@ -6,41 +6,133 @@
 #ifndef CMD_H
 #define CMD_H
 
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#if defined(_MSC_VER) && !defined(__GNUC__)
+#include <intrin.h> /* _InterlockedExchangeAdd, see cmd_fetch_add */
+#endif
+
+/* Define CMD_POSIX before including to enable helpers that need POSIX */
+#ifdef CMD_POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <unistd.h>
+#endif
+
+/* Define CMD_MINIMAL before including for small targets: lower default
+ * limits, one-byte option fields, small stack buffers and only the flag,
+ * string, integer and path option types */
+#ifdef CMD_MINIMAL
+#define CMD_SMALL(t) uint8_t
+#define CMD_DEFAULT_MAX 16
+#else
+#define CMD_SMALL(t) t
+#define CMD_DEFAULT_MAX 64
+#endif
 
 /* Maximum number of options that can be parsed */
 #ifndef CMD_MAX_OPTIONS
-#define CMD_MAX_OPTIONS 64
+#define CMD_MAX_OPTIONS CMD_DEFAULT_MAX
 #endif
 
 /* Maximum number of positional arguments that can be parsed */
 #ifndef CMD_MAX_POSITIONALS
-#define CMD_MAX_POSITIONALS 64
+#define CMD_MAX_POSITIONALS CMD_DEFAULT_MAX
+#endif
+
+/* Size of the stack buffer used by helpers that read files */
+#ifndef CMD_IO_BUFSIZE
+#ifdef CMD_MINIMAL
+#define CMD_IO_BUFSIZE 512
+#else
+#define CMD_IO_BUFSIZE 16384
+#endif
 #endif
 
+/* Flags for cmd_dedup_positionals */
+#define CMD_DEDUP_SORT 1 /* Sort the result instead of keeping input order */
+
 /* Option types */
 typedef enum {
 	CMD_OPT_FLAG, /* Flag option */
 	CMD_OPT_STR,  /* String option */
 	CMD_OPT_INT,  /* Integer option */
+#ifndef CMD_MINIMAL
+	CMD_OPT_HEX,  /* Hex-encoded binary option, decoded into buf */
+	CMD_OPT_B64,  /* Base64-encoded binary option, decoded into buf */
+	CMD_OPT_TIME, /* RFC 3339 timestamp option, as epoch nanoseconds */
+	CMD_OPT_IP,   /* IPv4 or IPv6 address option, binary form in buf */
+	CMD_OPT_CIDR, /* IPv4 or IPv6 network (addr/prefix) option */
+#endif
+#ifdef CMD_POSIX
+	/* Path option, must name an existing file or directory; the value is
+	 * fixed so schema blobs agree with CMD_MINIMAL builds */
+	CMD_OPT_PATH = 8,
+#endif
 } CMD_OptType;
 
-/* Option structure */
+#ifdef CMD_POSIX
+/* Path kinds for cmd_check_paths */
+typedef enum {
+	CMD_PATH_ANY,  /* Any existing path */
+	CMD_PATH_FILE, /* Existing regular file */
+	CMD_PATH_DIR,  /* Existing directory */
+} CMD_PathKind;
+
+/* Flags for cmd_glob_positionals */
+#define CMD_GLOB_SORT 1 /* Deliver the matches of each pattern sorted */
+#endif
+
+/* Parse modes (CMD_ParseCtl.mode) */
+#define CMD_MODE_STOP_AT_POSITIONAL (1 << 0) /* Stop at the first positional */
+#define CMD_MODE_PASSTHROUGH        (1 << 1) /* Record unknown options, don't fail */
+
+/* Option flags */
+#define CMD_OPTF_UTF8  (1 << 0) /* String value must be valid UTF-8 */
+#if defined(CMD_POSIX) && !defined(CMD_MINIMAL)
+#define CMD_OPTF_FILE  (1 << 1) /* "@path" string value maps the file instead */
+#endif
+#define CMD_OPTF_ICASE (1 << 2) /* Long name and aliases match ignoring case */
+
+/* Option structure
+ * The CMD_SMALL fields after help are kept together so that, as bytes,
+ * they share a word with int_val; type cannot move without breaking
+ * positional initialisers, so it stays padded either way.
+ */
 typedef struct {
-	char sname;          /* Short option name (e.g: 'f' for -f) */
-	const char *lname;   /* Long option name (e.g: "flag" for --flag) */
-	CMD_OptType type;    /* Option type */
-	const char *help;    /* Help description text */
-	int is_provided;     /* Whether option was provided */
-	int int_val;         /* Integer value (for CMD_OPT_INT) */
-	const char *str_val; /* String value (for CMD_OPT_STR) */
+	char sname;                  /* Short option name (e.g: 'f' for -f) */
+	const char *lname;           /* Long option name (e.g: "flag" for --flag, "a|b" for aliases) */
+	CMD_SMALL(CMD_OptType) type; /* Option type */
+	const char *help;            /* Help description text */
+	CMD_SMALL(int) flags;        /* Option flags (CMD_OPTF_*) */
+	CMD_SMALL(int) is_provided;  /* Whether option was provided */
+#if defined(CMD_POSIX) && !defined(CMD_MINIMAL)
+	CMD_SMALL(int) is_mapped;    /* Whether data is a file mapping (CMD_OPTF_FILE) */
+#endif
+	int int_val;                 /* Integer value (for CMD_OPT_INT, prefix for CIDR) */
+	const char *str_val;         /* String value (for CMD_OPT_STR and CMD_OPT_PATH) */
+#ifndef CMD_MINIMAL
+	int64_t time_val;            /* Epoch nanoseconds (for CMD_OPT_TIME) */
+	const void *data;            /* Value bytes (for CMD_OPT_STR, HEX, B64, IP, CIDR) */
+	size_t len;                  /* Length of data in bytes */
+	unsigned char *buf;          /* Decode buffer (for CMD_OPT_HEX, B64, IP, CIDR) */
+	size_t cap;                  /* Capacity of buf in bytes */
+#endif
 } CMD_Opt;
 
+/* Command flags */
+#define CMD_CMDF_ICASE (1 << 0) /* Name and aliases match ignoring case */
+
 /* Command structure */
 typedef struct {
-	const char *name;                  /* Command name */
+	const char *name;                  /* Command name ("remove|rm" for aliases) */
 	void (*fn)(int argc, char **argv); /* Command function pointer */
+	int limit;                         /* Max concurrent runs, 0 = unlimited */
+	int flags;                         /* Command flags (CMD_CMDF_*) */
 } CMD_Cmd;
 
 /* Parser result codes for error handling */
@@ -49,6 +141,7 @@ typedef enum {
 	CMD_PARSE_UNKNOWN_OPT,
 	CMD_PARSE_MISSING_VAL,
 	CMD_PARSE_INVALID_VAL,
+	CMD_PARSE_NO_MEM,
 } CMD_ParseResult;
 
 /* Parser output */
@@ -58,8 +151,67 @@ typedef struct {
 	const char * positionals[CMD_MAX_POSITIONALS];
 } CMD_ParseOut;
 
+/* Room for a command name in CMD_Timing, including the NUL */
+#ifndef CMD_TIMING_NAME_MAX
+#define CMD_TIMING_NAME_MAX 32
+#endif
+
+/* Timing history entry for cmd_timing_update and cmd_order_jobs.
+ * The name is copied in, so the table holds no pointers and can be
+ * written to a file and read back as is. */
+typedef struct {
+	char name[CMD_TIMING_NAME_MAX]; /* Command name */
+	double secs; /* Smoothed duration in seconds */
+	double args; /* Smoothed number of arguments after the command */
+} CMD_Timing;
+
+/* Batch job: one command line, argv[1] being the command name */
+typedef struct {
+	int argc;
+	char **argv;
+	double est; /* Estimated duration, set by cmd_order_jobs */
+} CMD_Job;
+
+/* Estimate given to jobs whose command has no timing history. It sorts
+ * them ahead of all known jobs: an unknown job may be the longest, and
+ * running it early gives its first measurement without risking the tail.
+ */
+#define CMD_JOB_UNKNOWN 1e300
+
+/* Parser control for wrapper-style parsing */
+typedef struct {
+	int mode;    /* Parse modes (CMD_MODE_*) */
+	int *passv;  /* Receives argv indices of unknown options */
+	int passcap; /* Capacity of passv */
+	int passc;   /* Number of indices stored in passv */
+	int stop;    /* Index where parsing stopped, argc if it reached the end */
+} CMD_ParseCtl;
+
+/* Parser output with positionals stored in a CMD_Arena */
+typedef struct {
+	CMD_ParseResult res;
+	int positionalc;
+	const char **positionals;
+} CMD_ParseArenaOut;
+
+/* Alignment unit of arena allocations */
+typedef union {
+	long long l;
+	double d;
+	void *p;
+} CMD_ArenaAlign;
+
+/* Bump allocator over caller-supplied memory */
+typedef struct {
+	char *buf;   /* Current block */
+	size_t cap;  /* Size of the current block */
+	size_t used; /* Bytes used in the current block */
+	void *(*grow)(size_t size, void *ud); /* Optional: new block of >= size bytes */
+	void *ud;    /* User data passed to grow */
+} CMD_Arena;
+
 /* Find option by short name */
-static CMD_Opt *
+static inline CMD_Opt *
 cmd_find_short_opt(char sname, CMD_Opt *opts, int optc)
 {
 	for (int i = 0; i < optc; i++) {
@@ -70,98 +222,583 @@ cmd_find_short_opt(char sname, CMD_Opt *opts, int optc)
 	return NULL;
 }
 
-/* Find option by long name */
-static CMD_Opt *
-cmd_find_long_opt(const char *lname, CMD_Opt *opts, int optc)
+/* Length of the canonical (first) name in a "name|alias|..." list */
+static inline size_t
+cmd_name_len(const char *names)
+{
+	return strcspn(names, "|");
+}
+
+/* Check whether the len bytes at s match any name in a "name|alias|..."
+ * list, optionally ignoring ASCII case.
+ */
+static inline int
+cmd_name_matches(const char *names, const char *s, size_t len, int icase)
+{
+	for (;;) {
+		size_t n = cmd_name_len(names);
+		if (n == len) {
+			size_t i = 0;
+			if (icase) {
+				// fold ASCII letters only: set bit 5 on A-Z
+				for (; i < len; i++) {
+					unsigned char a = (unsigned char)names[i], b = (unsigned char)s[i];
+					if ((unsigned)(a - 'A') < 26) a |= 0x20;
+					if ((unsigned)(b - 'A') < 26) b |= 0x20;
+					if (a != b) break;
+				}
+			} else if (memcmp(names, s, len) == 0) {
+				i = len;
+			}
+			if (i == len) return 1;
+		}
+		if (names[n] == '\0') return 0;
+		names += n + 1;
+	}
+}
+
+/* Find option by long name or alias, comparing the first len bytes of lname */
+static inline CMD_Opt *
+cmd_find_long_opt(const char *lname, size_t len, CMD_Opt *opts, int optc)
 {
 	for (int i = 0; i < optc; i++) {
-		if (opts[i].lname && strcmp(opts[i].lname, lname) == 0) {
+		if (opts[i].lname && cmd_name_matches(opts[i].lname, lname, len,
+		    opts[i].flags & CMD_OPTF_ICASE)) {
 			return &opts[i];
 		}
 	}
 	return NULL;
 }
 
-/* Check if string is a valid integer */
-static int
-cmd_is_valid_int(const char *str)
+/* Validate and convert a decimal integer in a single pass.
+ * Rejects empty strings, stray characters and values outside int range.
+ * Returns 1 and stores the value in *val on success, 0 otherwise.
+ */
+static inline int
+cmd_parse_int(const char *str, int *val)
 {
 	if (!str || *str == '\0') return 0;
 
 	const char *p = str;
+	int neg = (*p == '-');
 	if (*p == '-' || *p == '+') p++; // skip sign
+	if (*p == '\0') return 0;
+
+	// accumulate negatively so INT_MIN is representable
+	int n = 0;
 	while (*p) {
-		if (*p < '0' || *p > '9') return 0;
+		int d = *p - '0';
+		if (d < 0 || d > 9) return 0;
+		if (n < (INT_MIN + d) / 10) return 0;
+		n = n * 10 - d;
 		p++;
 	}
 
+	if (!neg) {
+		if (n == INT_MIN) return 0;
+		n = -n;
+	}
+	*val = n;
 	return 1;
 }
 
-/* Parse comamnd line options and positional arguments.
- * Modifies the options array in-place, setting present and values.
- * Captures positional arguments into CMD_ParseOut.
- *
- * Parameters:
- *   argc, argv - standard command line args
- *   opts       - array of CMD_Opt options
- *   optc       - number of options in the array
+/* Check if string is a valid integer */
+static inline int
+cmd_is_valid_int(const char *str)
+{
+	int val;
+	return cmd_parse_int(str, &val);
+}
+
+/* Check that len bytes at str are well-formed UTF-8: no overlong forms,
+ * no surrogates, nothing above U+10FFFF. ASCII is skipped eight bytes
+ * at a time.
+ */
+static inline int
+cmd_is_valid_utf8(const char *str, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	const unsigned char *end = p + len;
+
+	while (p < end) {
+		// fast path: eight ASCII bytes at once
+		if (end - p >= 8) {
+			uint64_t w;
+			memcpy(&w, p, 8);
+			if (!(w & 0x8080808080808080ULL)) {
+				p += 8;
+				continue;
+			}
+		}
+
+		unsigned c = *p;
+		int n;
+		unsigned lo = 0x80, hi = 0xbf; // bounds for the second byte
+		if (c < 0x80) {
+			p++;
+			continue;
+		} else if (c >= 0xc2 && c <= 0xdf) {
+			n = 1;
+		} else if (c >= 0xe0 && c <= 0xef) {
+			n = 2;
+			if (c == 0xe0) lo = 0xa0; // overlong
+			if (c == 0xed) hi = 0x9f; // surrogates
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 3;
+			if (c == 0xf0) lo = 0x90; // overlong
+			if (c == 0xf4) hi = 0x8f; // above U+10FFFF
+		} else {
+			return 0;
+		}
+
+		if (end - p <= n) return 0;
+		if (p[1] < lo || p[1] > hi) return 0;
+		for (int k = 2; k <= n; k++) {
+			if ((p[k] & 0xc0) != 0x80) return 0;
+		}
+		p += n + 1;
+	}
+	return 1;
+}
+
+/* Value of a hex digit, or -1 */
+static inline int
+cmd_hex_digit(unsigned char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	c |= 0x20; // ASCII lowercase
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+/* Decode a hex string (even length, either case) into dst.
+ * Returns the decoded length, or -1 if str is not valid hex or does not
+ * fit in cap bytes (*nomem is set in the latter case).
+ */
+static inline long
+cmd_decode_hex(const char *str, unsigned char *dst, size_t cap, int *nomem)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	size_t len = strlen(str);
+
+	*nomem = 0;
+	if (len % 2) return -1;
+	if (len / 2 > cap) {
+		*nomem = 1;
+		return -1;
+	}
+
+	for (size_t i = 0; i < len / 2; i++) {
+		int hi = cmd_hex_digit(p[2 * i]), lo = cmd_hex_digit(p[2 * i + 1]);
+		if ((hi | lo) < 0) return -1;
+		dst[i] = (unsigned char)(hi << 4 | lo);
+	}
+	return (long)(len / 2);
+}
+
+/* Value of a base64 digit (standard alphabet), or -1 */
+static inline int
+cmd_b64_digit(unsigned char c)
+{
+	if (c >= 'A' && c <= 'Z') return c - 'A';
+	if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+	if (c >= '0' && c <= '9') return c - '0' + 52;
+	if (c == '+') return 62;
+	if (c == '/') return 63;
+	return -1;
+}
+
+/* Decode padded base64 (RFC 4648, standard alphabet) into dst.
+ * Strict: the length must be a multiple of four, '=' may only pad the
+ * last group, and unused bits of the last digit must be zero.
+ * Returns the decoded length, or -1 if str is invalid or does not fit
+ * in cap bytes (*nomem is set in the latter case).
+ */
+static inline long
+cmd_decode_b64(const char *str, unsigned char *dst, size_t cap, int *nomem)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	size_t len = strlen(str), pad = 0, n;
+
+	*nomem = 0;
+	if (len % 4) return -1;
+	if (len && p[len - 1] == '=') pad++;
+	if (len && p[len - 2] == '=') pad++;
+	n = len / 4 * 3 - pad;
+	if (n > cap) {
+		*nomem = 1;
+		return -1;
+	}
+
+	size_t o = 0;
+	for (size_t i = 0; i < len; i += 4) {
+		int last = (i + 4 == len);
+		int a = cmd_b64_digit(p[i]), b = cmd_b64_digit(p[i + 1]);
+		int c = (last && pad == 2) ? 0 : cmd_b64_digit(p[i + 2]);
+		int d = (last && pad >= 1) ? 0 : cmd_b64_digit(p[i + 3]);
+		if ((a | b | c | d) < 0) return -1;
+
+		uint32_t v = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 | (uint32_t)d;
+		dst[o++] = (unsigned char)(v >> 16);
+		if (last && pad == 2) {
+			if (v & 0xffff) return -1; // non-canonical trailing bits
+			break;
+		}
+		dst[o++] = (unsigned char)(v >> 8);
+		if (last && pad == 1) {
+			if (v & 0xff) return -1;
+			break;
+		}
+		dst[o++] = (unsigned char)v;
+	}
+	return (long)n;
+}
+
+/* Read exactly n decimal digits at p into *v; returns 0 on a non-digit */
+static inline int
+cmd_read_digits(const char *p, int n, int *v)
+{
+	*v = 0;
+	for (int i = 0; i < n; i++) {
+		unsigned d = (unsigned)(p[i] - '0');
+		if (d > 9) return 0;
+		*v = *v * 10 + (int)d;
+	}
+	return 1;
+}
+
+/* Parse an RFC 3339 timestamp, e.g. "2024-05-01T12:30:00.25+02:00",
+ * into nanoseconds since the Unix epoch. Fields are read at fixed
+ * offsets; the separator may be 'T', 't' or ' ', the fraction has at
+ * most nine digits and the zone is 'Z', 'z' or +HH:MM / -HH:MM.
+ * Returns 1 on success, 0 if malformed or outside the int64_t range.
+ */
+static inline int
+cmd_parse_time(const char *str, int64_t *ns)
+{
+	int y, mo, d, h, mi, sec, frac = 0, oh = 0, om = 0;
+	const char *p = str;
+
+	if (!cmd_read_digits(p, 4, &y) || p[4] != '-' ||
+	    !cmd_read_digits(p + 5, 2, &mo) || p[7] != '-' ||
+	    !cmd_read_digits(p + 8, 2, &d) ||
+	    (p[10] != 'T' && p[10] != 't' && p[10] != ' ') ||
+	    !cmd_read_digits(p + 11, 2, &h) || p[13] != ':' ||
+	    !cmd_read_digits(p + 14, 2, &mi) || p[16] != ':' ||
+	    !cmd_read_digits(p + 17, 2, &sec))
+		return 0;
+	p += 19;
+
+	if (*p == '.') {
+		int n = 0;
+		for (p++; *p >= '0' && *p <= '9'; p++, n++) {
+			if (n == 9) return 0;
+			frac = frac * 10 + (*p - '0');
+		}
+		if (n == 0) return 0;
+		for (; n < 9; n++) frac *= 10;
+	}
+
+	if (*p == 'Z' || *p == 'z') {
+		p++;
+	} else if (*p == '+' || *p == '-') {
+		if (!cmd_read_digits(p + 1, 2, &oh) || p[3] != ':' ||
+		    !cmd_read_digits(p + 4, 2, &om) || oh > 23 || om > 59)
+			return 0;
+		if (*p == '-') {
+			oh = -oh;
+			om = -om;
+		}
+		p += 6;
+	} else {
+		return 0;
+	}
+	if (*p != '\0') return 0;
+
+	static const unsigned char mdays[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+	if (mo < 1 || mo > 12 || d < 1 || d > mdays[mo - 1] ||
+	    (mo == 2 && d == 29 && !leap) || h > 23 || mi > 59 || sec > 60)
+		return 0;
+
+	// days since 1970-01-01 in the proleptic Gregorian calendar
+	int64_t yy = y - (mo <= 2);
+	int64_t era = yy / 400;
+	int64_t yoe = yy - era * 400;
+	int64_t doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int64_t days = era * 146097 + doe - 719468;
+
+	int64_t secs = days * 86400 + h * 3600 + mi * 60 + sec - oh * 3600 - om * 60;
+	const int64_t g = 1000000000;
+
+	// secs * g + frac must fit: check whole seconds, then the fraction
+	if (secs > INT64_MAX / g || (secs == INT64_MAX / g && frac > INT64_MAX % g))
+		return 0;
+	if (secs < INT64_MIN / g - 1 ||
+	    (secs == INT64_MIN / g - 1 && frac < g + INT64_MIN % g))
+		return 0;
+	// below zero, step through secs + 1 so the product cannot overflow
+	*ns = secs < 0 ? (secs + 1) * g + (frac - g) : secs * g + frac;
+	return 1;
+}
+
+/* Parse a dotted-quad IPv4 address of exactly len bytes into out[4].
+ * Octets are 0-255 without leading zeros. Returns 1 on success.
+ */
+static inline int
+cmd_parse_ipv4(const char *str, size_t len, unsigned char *out)
+{
+	const char *p = str, *end = str + len;
+
+	for (int i = 0; i < 4; i++) {
+		int v = 0, n = 0;
+		if (i && (p == end || *p++ != '.')) return 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++, n++) {
+			if (n && v == 0) return 0; // leading zero
+			v = v * 10 + (*p - '0');
+			if (v > 255) return 0;
+		}
+		if (n == 0) return 0;
+		out[i] = (unsigned char)v;
+	}
+	return p == end;
+}
+
+/* Parse an IPv6 address of exactly len bytes into out[16], including
+ * "::" compression and a trailing dotted IPv4 part. Returns 1 on success.
+ */
+static inline int
+cmd_parse_ipv6(const char *str, size_t len, unsigned char *out)
+{
+	const char *p = str, *end = str + len;
+	int n = 0, gap = -1;
+
+	if (end - p >= 2 && p[0] == ':' && p[1] == ':') {
+		gap = 0;
+		p += 2;
+	}
+
+	while (p < end && n < 16) {
+		const char *q = p;
+		unsigned v = 0;
+		int digits = 0;
+		for (; q < end && digits < 5; q++, digits++) {
+			int x = cmd_hex_digit((unsigned char)*q);
+			if (x < 0) break;
+			v = v << 4 | (unsigned)x;
+		}
+
+		// trailing IPv4 part, e.g. ::ffff:192.0.2.1
+		if (q < end && *q == '.') {
+			if (n > 12 || !cmd_parse_ipv4(p, (size_t)(end - p), out + n)) return 0;
+			n += 4;
+			p = end;
+			break;
+		}
+
+		if (digits == 0 || digits > 4) return 0;
+		out[n++] = (unsigned char)(v >> 8);
+		out[n++] = (unsigned char)v;
+		p = q;
+		if (p == end) break;
+		if (*p++ != ':') return 0;
+		if (p < end && *p == ':') {
+			if (gap >= 0) return 0;
+			gap = n;
+			p++;
+		} else if (p == end) {
+			return 0; // trailing single ':'
+		}
+	}
+	if (p != end) return 0;
+
+	if (gap >= 0) {
+		if (n == 16) return 0;
+		memmove(out + gap + 16 - n, out + gap, (size_t)(n - gap));
+		memset(out + gap, 0, (size_t)(16 - n));
+	} else if (n != 16) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Parse an IPv4 or IPv6 address, with a "/prefix" suffix if prefix is
+ * not NULL (required in that case), into out (16 bytes of room).
+ * Returns the address length (4 or 16), or 0 if malformed.
+ */
+static inline int
+cmd_parse_ip(const char *str, unsigned char *out, int *prefix)
+{
+	const char *slash = strchr(str, '/');
+	size_t len = slash ? (size_t)(slash - str) : strlen(str);
+	int alen;
+
+	if (!prefix && slash) return 0;
+	if (prefix && !slash) return 0;
+
+	if (memchr(str, ':', len))
+		alen = cmd_parse_ipv6(str, len, out) ? 16 : 0;
+	else
+		alen = cmd_parse_ipv4(str, len, out) ? 4 : 0;
+	if (!alen || !prefix) return alen;
+
+	int bits;
+	const char *b = slash + 1;
+	size_t blen = strlen(b);
+	if (blen == 0 || blen > 3 || (blen > 1 && b[0] == '0') ||
+	    !cmd_read_digits(b, (int)blen, &bits) || bits > alen * 8)
+		return 0;
+	*prefix = bits;
+	return alen;
+}
+
+/* Convert an array of strings, e.g. a variadic tail of out.positionals,
+ * to integers in bulk. On failure *bad (if not NULL) receives the index
+ * of the first invalid string.
  *
  * Returns:
- *   CMD_ParseOut with result code and positional arguments.
+ *   CMD_PARSE_OK, or CMD_PARSE_INVALID_VAL if any string is not an int.
  */
-static CMD_ParseOut
-cmd_parse_options(int argc, char **argv, CMD_Opt *opts, int optc)
+static inline CMD_ParseResult
+cmd_parse_ints(const char *const *strs, int n, int *vals, int *bad)
+{
+	for (int i = 0; i < n; i++) {
+		if (!cmd_parse_int(strs[i], &vals[i])) {
+			if (bad) *bad = i;
+			return CMD_PARSE_INVALID_VAL;
+		}
+	}
+	return CMD_PARSE_OK;
+}
+
+#ifdef CMD_POSIX
+/* Map a file read-only, for zero-copy "@path" option values.
+ * Returns 1 and sets *data and *len on success, 0 otherwise.
+ */
+static inline int
+cmd_map_file(const char *path, const void **data, size_t *len)
+{
+	struct stat st;
+	void *map;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return 0;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	// mmap rejects empty mappings, and there is nothing to map anyway
+	if (st.st_size == 0) {
+		close(fd);
+		*data = "";
+		*len = 0;
+		return 1;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+
+	*data = map;
+	*len = (size_t)st.st_size;
+	return 1;
+}
+
+/* Unmap file contents mapped for CMD_OPTF_FILE options.
+ * Call once done with the values, before parsing into opts again.
+ * Only options marked is_mapped by the parser are touched.
+ */
+static inline void
+cmd_release_options(CMD_Opt *opts, int optc)
+{
+#ifdef CMD_MINIMAL
+	(void)opts; (void)optc; // nothing is mapped without CMD_OPTF_FILE
+#else
+	for (int i = 0; i < optc; i++) {
+		if (!opts[i].is_mapped) continue;
+		munmap((void *)opts[i].data, opts[i].len);
+		opts[i].is_mapped = 0;
+		opts[i].data = NULL;
+		opts[i].len = 0;
+	}
+#endif
+}
+#endif
+
+/* Parse options and positionals from argv[first] onwards.
+ * Shared by all parse entry points: positionals are stored into pos (up
+ * to poscap, further ones are dropped) and counted in *posc. ctl may be
+ * NULL for a plain parse; see CMD_ParseCtl for the wrapper modes.
+ */
+static inline CMD_ParseResult
+cmd_parse_core(int argc, char **argv, int first, CMD_Opt *opts, int optc,
+		const char **pos, int poscap, int *posc, CMD_ParseCtl *ctl)
 {
-	CMD_ParseOut out = {0};
-	out.res = CMD_PARSE_OK;
+	int mode = ctl ? ctl->mode : 0;
+
+	if (ctl) {
+		ctl->passc = 0;
+		ctl->stop = argc;
+	}
 
 	// Reset all options
 	for (int i = 0; i < optc; i++) {
 		opts[i].is_provided = 0;
 		opts[i].str_val = NULL;
 		opts[i].int_val = 0;
+#ifndef CMD_MINIMAL
+		opts[i].time_val = 0;
+#ifdef CMD_POSIX
+		if (opts[i].is_mapped) continue; // still owned, see cmd_release_options
+#endif
+		opts[i].data = NULL;
+		opts[i].len = 0;
+#endif
 	}
 
-	// note: skip program name and command name
-	for (int i = 2; i < argc; i++) {
+	*posc = 0;
+	for (int i = first; i < argc; i++) {
 		char *arg = argv[i];
 		CMD_Opt *opt = NULL;
 		const char *val = NULL;
 
-		// Long option
-		if (strncmp(arg, "--", 2) == 0) {
-			char *eq_pos = strchr(arg + 2, '=');
-			if (eq_pos) {
-				*eq_pos = '\0';
-				val = eq_pos + 1;
-			}
-
-			if (!(opt = cmd_find_long_opt(arg + 2, opts, optc))) {
-				out.res = CMD_PARSE_UNKNOWN_OPT;
-				return out;
+		// Positional argument: decided on the first byte alone, so long
+		// runs of positionals skip the option lookup entirely
+		if (arg[0] != '-' || arg[1] == '\0') {
+			if (mode & CMD_MODE_STOP_AT_POSITIONAL) {
+				ctl->stop = i;
+				return CMD_PARSE_OK;
 			}
+			if (*posc < poscap)
+				pos[(*posc)++] = arg;
+			continue;
+		}
 
+		// Long option
+		if (arg[1] == '-') {
+			const char *eq_pos = strchr(arg + 2, '=');
+			size_t len = eq_pos ? (size_t)(eq_pos - (arg + 2)) : strlen(arg + 2);
 			if (eq_pos)
-				*eq_pos = '='; // restore original string
+				val = eq_pos + 1;
+
+			if (!(opt = cmd_find_long_opt(arg + 2, len, opts, optc)))
+				goto unknown;
 
 			// if no value found with =, check next argument
 			if (!val && opt->type != CMD_OPT_FLAG) {
-				if (i + 1 < argc && argv[i + 1][0] != '-') {
+				if (i + 1 < argc && argv[i + 1][0] != '-')
 					val = argv[++i];
-				} else {
-					out.res = CMD_PARSE_MISSING_VAL;
-					return out;
-				}
+				else
+					return CMD_PARSE_MISSING_VAL;
 			}
 
 		// Short option
-		} else if (arg[0] == '-' && arg[1] != '\0') {
+		} else {
 			char short_opt = arg[1];
-			if (!(opt = cmd_find_short_opt(short_opt, opts, optc))) {
-				out.res = CMD_PARSE_UNKNOWN_OPT;
-				return out;
-			}
+			if (!(opt = cmd_find_short_opt(short_opt, opts, optc)))
+				goto unknown;
 
 			if (opt->type != CMD_OPT_FLAG) {
 				// value attached: -svalue
@@ -174,59 +811,1276 @@ cmd_parse_options(int argc, char **argv, CMD_Opt *opts, int optc)
 
 				// missing value
 				} else {
-					out.res = CMD_PARSE_MISSING_VAL;
-					return out;
+					return CMD_PARSE_MISSING_VAL;
 				}
 			}
-
-		// Positional argument
-		} else if (out.positionalc < CMD_MAX_POSITIONALS) {
-			out.positionals[out.positionalc++] = arg;
-			continue;
 		}
 
 		// Assign option type when parsed
-		if (opt) {
-			opt->is_provided = 1;
-			switch (opt->type) {
-			case CMD_OPT_FLAG: break;
-			case CMD_OPT_STR:
-				opt->str_val = val;
-				break;
-			case CMD_OPT_INT:
-				if (!val || !cmd_is_valid_int(val)) {
-					out.res = CMD_PARSE_INVALID_VAL;
-					return out;
+		opt->is_provided = 1;
+		switch (opt->type) {
+		case CMD_OPT_FLAG: break;
+		case CMD_OPT_STR:
+#ifdef CMD_MINIMAL
+			opt->str_val = val;
+			if ((opt->flags & CMD_OPTF_UTF8) &&
+			    !cmd_is_valid_utf8(val, strlen(val)))
+				return CMD_PARSE_INVALID_VAL;
+#else
+#ifdef CMD_POSIX
+			if (opt->is_mapped) { // repeated or re-parsed: drop the earlier file
+				munmap((void *)opt->data, opt->len);
+				opt->is_mapped = 0;
+			}
+#endif
+			opt->str_val = val;
+			opt->data = val;
+			opt->len = strlen(val);
+#ifdef CMD_POSIX
+			if ((opt->flags & CMD_OPTF_FILE) && val[0] == '@') {
+				if (!cmd_map_file(val + 1, &opt->data, &opt->len)) {
+					opt->data = NULL;
+					opt->len = 0;
+					return CMD_PARSE_INVALID_VAL;
 				}
-				opt->int_val = atoi(val);
-				break;
+				opt->is_mapped = opt->len > 0; // empty files are not mapped
 			}
+#endif
+			if ((opt->flags & CMD_OPTF_UTF8) &&
+			    !cmd_is_valid_utf8((const char *)opt->data, opt->len))
+				return CMD_PARSE_INVALID_VAL;
+#endif
+			break;
+		case CMD_OPT_INT:
+			if (!cmd_parse_int(val, &opt->int_val))
+				return CMD_PARSE_INVALID_VAL;
+			break;
+#ifndef CMD_MINIMAL
+		case CMD_OPT_HEX:
+		case CMD_OPT_B64: {
+			int nomem;
+			long n = opt->type == CMD_OPT_HEX
+				? cmd_decode_hex(val, opt->buf, opt->cap, &nomem)
+				: cmd_decode_b64(val, opt->buf, opt->cap, &nomem);
+			if (n < 0)
+				return nomem ? CMD_PARSE_NO_MEM : CMD_PARSE_INVALID_VAL;
+			opt->str_val = val;
+			opt->data = opt->buf;
+			opt->len = (size_t)n;
+			break;
+		}
+		case CMD_OPT_TIME:
+			if (!cmd_parse_time(val, &opt->time_val))
+				return CMD_PARSE_INVALID_VAL;
+			opt->str_val = val;
+			break;
+		case CMD_OPT_IP:
+		case CMD_OPT_CIDR: {
+			unsigned char ip[16];
+			int n = cmd_parse_ip(val, ip,
+				opt->type == CMD_OPT_CIDR ? &opt->int_val : NULL);
+			if (!n)
+				return CMD_PARSE_INVALID_VAL;
+			if ((size_t)n > opt->cap)
+				return CMD_PARSE_NO_MEM;
+			memcpy(opt->buf, ip, (size_t)n);
+			opt->str_val = val;
+			opt->data = opt->buf;
+			opt->len = (size_t)n;
+			break;
+		}
+#endif
+#ifdef CMD_POSIX
+		case CMD_OPT_PATH: {
+			struct stat st;
+			if (!val || stat(val, &st) != 0)
+				return CMD_PARSE_INVALID_VAL;
+			opt->str_val = val;
+			break;
 		}
+#endif
+		}
+		continue;
+
+	unknown:
+		if (!(mode & CMD_MODE_PASSTHROUGH))
+			return CMD_PARSE_UNKNOWN_OPT;
+		if (ctl->passc == ctl->passcap)
+			return CMD_PARSE_NO_MEM;
+		ctl->passv[ctl->passc++] = i;
 	}
 
+	return CMD_PARSE_OK;
+}
+
+/* Same as cmd_parse_options, but fills a caller-provided CMD_ParseOut
+ * instead of returning it by value, which avoids a struct copy on
+ * compilers that do not elide it. Rather than zeroing the whole array,
+ * only the entry after the last positional is set to NULL, if there is
+ * room. Returns out->res.
+ */
+static inline CMD_ParseResult
+cmd_parse_options_into(int argc, char **argv, CMD_Opt *opts, int optc,
+		CMD_ParseOut *out)
+{
+	out->positionalc = 0;
+
+	// note: skip program name and command name
+	out->res = cmd_parse_core(argc, argv, 2, opts, optc,
+		out->positionals, CMD_MAX_POSITIONALS, &out->positionalc, NULL);
+	if (out->positionalc < CMD_MAX_POSITIONALS)
+		out->positionals[out->positionalc] = NULL;
+	return out->res;
+}
+
+/* Parse comamnd line options and positional arguments.
+ * Modifies the options array in-place, setting present and values.
+ * Captures positional arguments into CMD_ParseOut.
+ * The argv strings are never written to, so the same argv may be parsed
+ * concurrently from several threads, each with its own options array.
+ *
+ * Parameters:
+ *   argc, argv - standard command line args
+ *   opts       - array of CMD_Opt options
+ *   optc       - number of options in the array
+ *
+ * Returns:
+ *   CMD_ParseOut with result code and positional arguments.
+ */
+static inline CMD_ParseOut
+cmd_parse_options(int argc, char **argv, CMD_Opt *opts, int optc)
+{
+	CMD_ParseOut out;
+	memset(&out, 0, sizeof(out)); // unused positionals read as NULL
+	cmd_parse_options_into(argc, argv, opts, optc, &out);
 	return out;
 }
 
-/* Find command by name */
-static const CMD_Cmd *
-cmd_find_command(const char *name, const CMD_Cmd *commands)
+/* Parse like cmd_parse_options, for wrappers that forward arguments.
+ * With CMD_MODE_PASSTHROUGH in ctl->mode, unknown options do not fail
+ * the parse; their argv indices are recorded in ctl->passv instead
+ * (CMD_PARSE_NO_MEM if it fills up). Only the unknown token itself is
+ * recorded, so a value given as a separate argument is seen as a
+ * positional. With CMD_MODE_STOP_AT_POSITIONAL, parsing ends at the
+ * first positional and argv[ctl->stop..] is left untouched for the child.
+ */
+static inline CMD_ParseOut
+cmd_parse_options_ctl(int argc, char **argv, CMD_Opt *opts, int optc,
+		CMD_ParseCtl *ctl)
 {
-	for (int i = 0; commands[i].name != NULL; i++) {
-		if (strcmp(commands[i].name, name) == 0) {
-			return &commands[i];
-		}
-	}
-	return NULL;
+	CMD_ParseOut out;
+	memset(&out, 0, sizeof(out));
+
+	// note: skip program name and command name
+	out.res = cmd_parse_core(argc, argv, 2, opts, optc,
+		out.positionals, CMD_MAX_POSITIONALS, &out.positionalc, ctl);
+	return out;
 }
 
-/* Dispatch command based on name */
-static int
-cmd_dispatch(int argc, char **argv, const CMD_Cmd *commands)
+/* Allocate size bytes from the arena, aligned for any scalar type.
+ * The address is aligned, not the offset, so buf itself may be
+ * unaligned (e.g. a plain char array).
+ * When the current block is full, the grow hook (if any) is asked for a
+ * new block of at least size bytes; the old block is left to the hook's
+ * owner. Returns NULL if the arena is exhausted.
+ */
+static inline void *
+cmd_arena_alloc(CMD_Arena *a, size_t size)
 {
-	const CMD_Cmd *cmd = cmd_find_command(argv[1], commands);
-	if (!cmd) return 0;
+	size_t align = sizeof(CMD_ArenaAlign);
+	size_t off = a->used +
+		((0u - ((uintptr_t)a->buf + a->used)) & (align - 1));
 
-	cmd->fn(argc, argv);
+	if (off > a->cap || size > a->cap - off) {
+		size_t want = size + align - 1; // room to align an odd block
+		if (want < 2 * a->cap) want = 2 * a->cap;
+		void *blk = a->grow ? a->grow(want, a->ud) : NULL;
+		if (!blk) return NULL;
+		a->buf = (char *)blk;
+		a->cap = want;
+		off = (0u - (uintptr_t)blk) & (align - 1);
+	}
+
+	a->used = off + size;
+	return a->buf + off;
+}
+
+/* Release everything allocated from the current block in O(1) */
+static inline void
+cmd_arena_reset(CMD_Arena *a)
+{
+	a->used = 0;
+}
+
+/* Parse like cmd_parse_options, but store positionals in an arena.
+ * There is no CMD_MAX_POSITIONALS limit: room for every remaining
+ * argument is taken from the arena up front, so no positional is ever
+ * dropped. Fails with CMD_PARSE_NO_MEM if the arena cannot hold it.
+ */
+static inline CMD_ParseArenaOut
+cmd_parse_options_arena(int argc, char **argv, CMD_Opt *opts, int optc,
+		CMD_Arena *a)
+{
+	CMD_ParseArenaOut out;
+	int cap = argc > 2 ? argc - 2 : 0;
+
+	memset(&out, 0, sizeof(out));
+	out.positionals = (const char **)cmd_arena_alloc(a,
+		(cap ? cap : 1) * sizeof(*out.positionals));
+	if (!out.positionals) {
+		out.res = CMD_PARSE_NO_MEM;
+		return out;
+	}
+
+	// note: skip program name and command name
+	out.res = cmd_parse_core(argc, argv, 2, opts, optc,
+		out.positionals, cap, &out.positionalc, NULL);
+	return out;
+}
+
+/* Split n positional arguments into contiguous, ordered chunks.
+ * n is out.positionalc of either CMD_ParseOut or CMD_ParseArenaOut.
+ * Worker number `worker` (0 <= worker < nworkers) gets the half-open
+ * index range [*begin, *end) of the positionals; chunk sizes differ by
+ * at most one. Results written per index can be read back in input order.
+ *
+ * Returns:
+ *   Number of positionals in the chunk (may be 0), or -1 with an empty
+ *   range if nworkers <= 0 or worker is out of range.
+ */
+static inline int
+cmd_positionals_chunk(int n, int worker, int nworkers, int *begin, int *end)
+{
+	*begin = *end = 0;
+	if (nworkers <= 0 || worker < 0 || worker >= nworkers) return -1;
+
+	int base = n / nworkers, extra = n % nworkers;
+
+	*begin = worker * base + (worker < extra ? worker : extra);
+	*end = *begin + base + (worker < extra);
+	return *end - *begin;
+}
+
+#ifdef CMD_POSIX
+/* Check that every path exists and is of the given kind.
+ * All paths are checked in one pass after parsing, e.g. over
+ * out.positionals. If sts is not NULL, sts[i] receives the stat result
+ * for paths[i], so sizes and types need not be queried again.
+ *
+ * Returns:
+ *   Index of the first path that fails the check, or -1 if all pass.
+ */
+static inline int
+cmd_check_paths(const char *const *paths, int n, CMD_PathKind kind,
+		struct stat *sts)
+{
+	struct stat st;
+
+	for (int i = 0; i < n; i++) {
+		struct stat *sp = sts ? &sts[i] : &st;
+		if (stat(paths[i], sp) != 0) return i;
+		if (kind == CMD_PATH_FILE && !S_ISREG(sp->st_mode)) return i;
+		if (kind == CMD_PATH_DIR && !S_ISDIR(sp->st_mode)) return i;
+	}
+	return -1;
+}
+
+/* Expand positionals as glob(3) patterns and stream every match to fn.
+ * Patterns without matches are passed through unchanged, like the shell
+ * does. Matches are unsorted unless CMD_GLOB_SORT is given. If fn returns
+ * non-zero, expansion stops. Unlike the rest of the library, this relies
+ * on glob(3), which allocates internally; the memory is freed before
+ * returning.
+ *
+ * Returns:
+ *   Number of paths delivered to fn, or -1 if a pattern failed to expand.
+ */
+static inline int
+cmd_glob_positionals(const CMD_ParseOut *out, int flags,
+		int (*fn)(const char *path, void *ud), void *ud)
+{
+	int n = 0;
+	int gflags = GLOB_NOCHECK | (flags & CMD_GLOB_SORT ? 0 : GLOB_NOSORT);
+
+	for (int i = 0; i < out->positionalc; i++) {
+		glob_t g;
+		if (glob(out->positionals[i], gflags, NULL, &g) != 0) {
+			globfree(&g);
+			return -1;
+		}
+		for (size_t j = 0; j < g.gl_pathc; j++) {
+			n++;
+			if (fn(g.gl_pathv[j], ud)) {
+				globfree(&g);
+				return n;
+			}
+		}
+		globfree(&g);
+	}
+	return n;
+}
+#endif
+
+/* FNV-1a hash of n bytes, continuing from h (start with CMD_HASH_INIT) */
+#define CMD_HASH_INIT 0xcbf29ce484222325ULL
+static inline uint64_t
+cmd_hash_bytes(uint64_t h, const void *p, size_t n)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	for (size_t i = 0; i < n; i++) {
+		h ^= s[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Remove duplicate strings in place, keeping the first occurrence of each.
+ * Uses an open-addressing hash table in caller memory: slots must hold
+ * nslots ints, with nslots > n (twice n keeps probe chains short).
+ *
+ * Returns:
+ *   Number of strings left in strs, or -1 if nslots is not greater
+ *   than n (the probe loop needs a free slot to end).
+ */
+static inline int
+cmd_dedup_strs(const char **strs, int n, int *slots, int nslots)
+{
+	int m = 0;
+
+	if (nslots <= n || nslots <= 0) return -1;
+	for (int i = 0; i < nslots; i++) slots[i] = -1;
+
+	for (int i = 0; i < n; i++) {
+		size_t len = strlen(strs[i]);
+		size_t j = cmd_hash_bytes(CMD_HASH_INIT, strs[i], len) % nslots;
+		int dup = 0;
+
+		for (; slots[j] >= 0; j = (j + 1) % nslots) {
+			if (strcmp(strs[slots[j]], strs[i]) == 0) {
+				dup = 1;
+				break;
+			}
+		}
+		if (dup) continue;
+
+		// slots index the compacted array, which is never ahead of i
+		strs[m] = strs[i];
+		slots[j] = m++;
+	}
+	return m;
+}
+
+/* qsort comparator for an array of C strings */
+static inline int
+cmd_strcmp_ptr(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* Remove duplicate positional arguments in place.
+ * By default the first occurrence of each value is kept in input order;
+ * with CMD_DEDUP_SORT the positionals are sorted and made unique.
+ */
+static inline void
+cmd_dedup_positionals(CMD_ParseOut *out, int flags)
+{
+	if (flags & CMD_DEDUP_SORT) {
+		int m = 0;
+		qsort(out->positionals, out->positionalc,
+			sizeof(out->positionals[0]), cmd_strcmp_ptr);
+		for (int i = 0; i < out->positionalc; i++) {
+			if (m == 0 || strcmp(out->positionals[m - 1], out->positionals[i]) != 0)
+				out->positionals[m++] = out->positionals[i];
+		}
+		out->positionalc = m;
+	} else {
+		int slots[2 * CMD_MAX_POSITIONALS];
+		out->positionalc = cmd_dedup_strs(out->positionals, out->positionalc,
+			slots, 2 * CMD_MAX_POSITIONALS);
+	}
+}
+
+/* Read four hex digits of a JSON \u escape, or return -1 */
+static inline long
+cmd_json_hex4(const char *p)
+{
+	long v = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = p[i];
+		v <<= 4;
+		if (c >= '0' && c <= '9') v |= c - '0';
+		else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+		else return -1;
+	}
+	return v;
+}
+
+/* Decode a JSON array of strings into an argument vector, in place.
+ * Escapes are unescaped into buf itself (a decoded string is never
+ * longer than its encoding) and each string is NUL-terminated where its
+ * closing quote was, so argv points into buf and nothing is copied.
+ * argv is NULL-terminated like a real one and can be fed to cmd_dispatch
+ * or cmd_parse_options.
+ *
+ * Parameters:
+ *   buf, len - JSON text, e.g. read from stdin; modified in place
+ *   argv     - receives pointers to the decoded strings and a NULL
+ *   maxargs  - capacity of argv, including the NULL
+ *
+ * Returns:
+ *   Number of strings, or -1 on malformed input, embedded NUL or overflow.
+ */
+static inline int
+cmd_json_argv(char *buf, size_t len, char **argv, int maxargs)
+{
+	char *p = buf, *end = buf + len;
+	int argc = 0;
+
+#define CMD_JSON_WS() while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++
+	CMD_JSON_WS();
+	if (p == end || *p++ != '[') return -1;
+	CMD_JSON_WS();
+	if (p < end && *p == ']') {
+		p++;
+		goto done;
+	}
+
+	for (;;) {
+		if (p == end || *p++ != '"') return -1;
+		if (argc + 1 >= maxargs) return -1; // keep a slot for NULL
+		char *w = p;
+		argv[argc++] = w;
+
+		for (;;) {
+			if (p == end) return -1;
+			unsigned char c = (unsigned char)*p++;
+			if (c == '"') break;
+			if (c < 0x20) return -1;
+			if (c != '\\') {
+				*w++ = (char)c;
+				continue;
+			}
+
+			if (p == end) return -1;
+			switch (*p++) {
+			case '"':  *w++ = '"';  break;
+			case '\\': *w++ = '\\'; break;
+			case '/':  *w++ = '/';  break;
+			case 'b':  *w++ = '\b'; break;
+			case 'f':  *w++ = '\f'; break;
+			case 'n':  *w++ = '\n'; break;
+			case 'r':  *w++ = '\r'; break;
+			case 't':  *w++ = '\t'; break;
+			case 'u': {
+				long cp;
+				if (end - p < 4 || (cp = cmd_json_hex4(p)) < 0) return -1;
+				p += 4;
+				if (cp >= 0xd800 && cp <= 0xdbff) { // surrogate pair
+					long lo;
+					if (end - p < 6 || p[0] != '\\' || p[1] != 'u') return -1;
+					if ((lo = cmd_json_hex4(p + 2)) < 0xdc00 || lo > 0xdfff) return -1;
+					p += 6;
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				} else if (cp >= 0xdc00 && cp <= 0xdfff) {
+					return -1;
+				}
+				if (cp == 0) return -1;
+
+				if (cp < 0x80) {
+					*w++ = (char)cp;
+				} else if (cp < 0x800) {
+					*w++ = (char)(0xc0 | (cp >> 6));
+					*w++ = (char)(0x80 | (cp & 0x3f));
+				} else if (cp < 0x10000) {
+					*w++ = (char)(0xe0 | (cp >> 12));
+					*w++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+					*w++ = (char)(0x80 | (cp & 0x3f));
+				} else {
+					*w++ = (char)(0xf0 | (cp >> 18));
+					*w++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+					*w++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+					*w++ = (char)(0x80 | (cp & 0x3f));
+				}
+				break;
+			}
+			default: return -1;
+			}
+		}
+		*w = '\0';
+
+		CMD_JSON_WS();
+		if (p == end) return -1;
+		if (*p == ']') {
+			p++;
+			break;
+		}
+		if (*p++ != ',') return -1;
+		CMD_JSON_WS();
+	}
+
+done:
+	CMD_JSON_WS();
+#undef CMD_JSON_WS
+	if (p != end || argc >= maxargs) return -1;
+	argv[argc] = NULL;
+	return argc;
+}
+
+/* getopt_long-compatible argument kinds */
+#define CMD_NO_ARGUMENT       0
+#define CMD_REQUIRED_ARGUMENT 1
+#define CMD_OPTIONAL_ARGUMENT 2
+
+/* getopt_long-compatible long option (same layout as struct option) */
+typedef struct {
+	const char *name; /* Long option name */
+	int has_arg;      /* CMD_NO_ARGUMENT, CMD_REQUIRED_ARGUMENT, ... */
+	int *flag;        /* If not NULL, *flag = val and 0 is returned */
+	int val;          /* Value to return or store in *flag */
+} CMD_LongOpt;
+
+/* getopt_long state; zero-initialise before the first call */
+typedef struct {
+	int optind;   /* Index of the next argv element to process */
+	char *optarg; /* Argument of the last option, or NULL */
+	int optopt;   /* Option character that caused the last error */
+	int nextchar; /* Offset within argv[optind] of clustered short options */
+} CMD_Getopt;
+
+/* Drop-in replacement for getopt_long(3) with explicit state.
+ * Follows the same call pattern: loop until -1, read optarg and optind
+ * from the state instead of globals. argv is never permuted: parsing
+ * stops at the first non-option (as with POSIXLY_CORRECT) or after "--",
+ * and g->optind then indexes the first positional. Long options match
+ * exactly or by unique prefix. No diagnostics are printed; '?' is
+ * returned for unknown options and for missing arguments (':' if
+ * optstring starts with ':'). A leading '+' is accepted and changes
+ * nothing; with a leading '-', each non-option is returned as option 1
+ * with the argument in optarg, as in GNU getopt.
+ * This is a standalone scanner, not a front end to cmd_parse_core: the
+ * getopt_long contract (one option per call in argv order, abbreviated
+ * long names, optional arguments, *flag stores) has no CMD_Opt
+ * equivalent, and longopts is searched linearly as in glibc. It eases
+ * porting; moving the table to CMD_Opt is what gets the parse engine.
+ */
+static inline int
+cmd_getopt_long(CMD_Getopt *g, int argc, char **argv, const char *optstring,
+		const CMD_LongOpt *longopts, int *longindex)
+{
+	int inorder = (optstring[0] == '-');
+	if (optstring[0] == '+' || inorder) optstring++;
+	int colon = (optstring[0] == ':');
+	if (colon) optstring++;
+
+	g->optarg = NULL;
+	if (g->optind == 0) g->optind = 1;
+
+	if (g->nextchar == 0) {
+		if (g->optind >= argc) return -1;
+		char *arg = argv[g->optind];
+		if (arg[0] != '-' || arg[1] == '\0') {
+			if (!inorder) return -1;
+			g->optarg = argv[g->optind++];
+			return 1;
+		}
+		if (arg[1] == '-' && arg[2] == '\0') {
+			g->optind++;
+			return -1;
+		}
+
+		// Long option
+		if (arg[1] == '-' && longopts) {
+			const char *name = arg + 2;
+			const char *eq_pos = strchr(name, '=');
+			size_t len = eq_pos ? (size_t)(eq_pos - name) : strlen(name);
+			int match = -1, ambiguous = 0;
+
+			g->optind++;
+			for (int i = 0; longopts[i].name; i++) {
+				if (strncmp(longopts[i].name, name, len) != 0) continue;
+				if (longopts[i].name[len] == '\0') {
+					match = i;
+					ambiguous = 0;
+					break;
+				}
+				if (match < 0) match = i;
+				else ambiguous = 1;
+			}
+			if (match < 0 || ambiguous) {
+				g->optopt = 0;
+				return '?';
+			}
+
+			const CMD_LongOpt *lo = &longopts[match];
+			if (longindex) *longindex = match;
+			if (eq_pos) {
+				if (lo->has_arg == CMD_NO_ARGUMENT) {
+					g->optopt = lo->val;
+					return '?';
+				}
+				g->optarg = (char *)eq_pos + 1;
+			} else if (lo->has_arg == CMD_REQUIRED_ARGUMENT) {
+				if (g->optind >= argc) {
+					g->optopt = lo->val;
+					return colon ? ':' : '?';
+				}
+				g->optarg = argv[g->optind++];
+			}
+
+			if (lo->flag) {
+				*lo->flag = lo->val;
+				return 0;
+			}
+			return lo->val;
+		}
+
+		g->nextchar = 1;
+	}
+
+	// Short option, possibly clustered: -abc, -ovalue, -o value
+	char *arg = argv[g->optind];
+	char c = arg[g->nextchar++];
+	const char *spec = (c != ':') ? strchr(optstring, c) : NULL;
+	int last = (arg[g->nextchar] == '\0');
+
+	if (!spec) {
+		g->optopt = c;
+		if (last) {
+			g->nextchar = 0;
+			g->optind++;
+		}
+		return '?';
+	}
+
+	if (spec[1] == ':') {
+		if (!last) {
+			g->optarg = arg + g->nextchar;
+		} else if (spec[2] != ':') {
+			if (g->optind + 1 >= argc) {
+				g->nextchar = 0;
+				g->optind++;
+				g->optopt = c;
+				return colon ? ':' : '?';
+			}
+			g->optarg = argv[++g->optind];
+		}
+		g->nextchar = 0;
+		g->optind++;
+	} else if (last) {
+		g->nextchar = 0;
+		g->optind++;
+	}
+	return c;
+}
+
+/* Append the decimal form of v to buf, returning the number of bytes */
+static inline size_t
+cmd_format_int(char *buf, int v)
+{
+	char tmp[16];
+	size_t n = 0, len = 0;
+	unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+
+	do {
+		tmp[n++] = (char)('0' + u % 10);
+		u /= 10;
+	} while (u);
+	if (v < 0) buf[len++] = '-';
+	while (n) buf[len++] = tmp[--n];
+	return len;
+}
+
+/* Store a 32-bit value little-endian */
+static inline void
+cmd_put_u32(unsigned char *p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+/* Load a 32-bit little-endian value */
+static inline uint32_t
+cmd_get_u32(const unsigned char *p)
+{
+	uint32_t v = 0;
+	for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+	return v;
+}
+
+/* Serialize parsed options and positionals back into an argument vector.
+ * Every provided option is written in canonical form, in schema order:
+ * `--lname` or `--lname=value` using the first long name (never an
+ * alias), or `-s` / `-svalue` for options without a long name (`-s ""`
+ * for an empty value). Integers are written from int_val, other values
+ * from str_val, so options can be modified before building. Option
+ * strings are stored NUL-terminated in buf; positionals are referenced,
+ * not copied. argv is NULL-terminated, ready for execv after the caller
+ * prepends the program and command names. Identical invocations always
+ * produce identical vectors, so the result can also serve as a cache key.
+ *
+ * Returns:
+ *   Number of arguments written, or -1 if buf or argv is too small.
+ */
+static inline int
+cmd_build_argv(const CMD_Opt *opts, int optc, const char *const *pos,
+		int posc, char *buf, size_t bufsz, char **argv, int maxargs)
+{
+	size_t used = 0;
+	int n = 0;
+
+	for (int i = 0; i < optc; i++) {
+		const CMD_Opt *opt = &opts[i];
+		const char *val = NULL;
+		char num[16];
+		size_t llen = opt->lname ? cmd_name_len(opt->lname) : 0, vlen = 0;
+
+		if (!opt->is_provided) continue;
+		if (opt->type == CMD_OPT_INT) {
+			vlen = cmd_format_int(num, opt->int_val);
+			val = num;
+		} else if (opt->type != CMD_OPT_FLAG && opt->str_val) {
+			val = opt->str_val;
+			vlen = strlen(val);
+		}
+
+		// "--" name "=" value NUL, or "-" sname value NUL; an empty
+		// short value goes in its own "" argument, as -s alone needs one
+		int split = !opt->lname && val && !vlen;
+		size_t need = (opt->lname ? 2 + llen + 1 : 2) + vlen + 1;
+		if (n + 1 + split >= maxargs || bufsz - used < need) return -1;
+
+		char *w = buf + used;
+		argv[n++] = w;
+		*w++ = '-';
+		if (opt->lname) {
+			*w++ = '-';
+			memcpy(w, opt->lname, llen);
+			w += llen;
+			if (val) *w++ = '=';
+		} else {
+			*w++ = opt->sname;
+		}
+		if (val) {
+			memcpy(w, val, vlen);
+			w += vlen;
+		}
+		*w++ = '\0';
+		if (split) argv[n++] = w - 1; // the NUL just written
+		used = (size_t)(w - buf);
+	}
+
+	for (int i = 0; i < posc; i++) {
+		if (n + 1 >= maxargs) return -1;
+		argv[n++] = (char *)pos[i];
+	}
+
+	if (n >= maxargs) return -1;
+	argv[n] = NULL;
+	return n;
+}
+
+/* Fold a u32 into hash h, little-endian */
+static inline uint64_t
+cmd_hash_u32(uint64_t h, uint32_t v)
+{
+	unsigned char t[4];
+	cmd_put_u32(t, v);
+	return cmd_hash_bytes(h, t, sizeof(t));
+}
+
+/* Fold n bytes into hash h behind their length, so that adjacent
+ * fields cannot run together */
+static inline uint64_t
+cmd_hash_field(uint64_t h, const void *p, size_t n)
+{
+	return cmd_hash_bytes(cmd_hash_u32(h, (uint32_t)n), p, n);
+}
+
+/* Hash an invocation for memoization: command name, provided options
+ * and positionals. Each option is identified by its schema index and
+ * every variable-length part is length-prefixed, so the encoding is
+ * unambiguous and keys are only comparable under the same schema. Time,
+ * binary and address values are hashed as parsed (time_val, data/len,
+ * prefix), not as typed, and an "@path" CMD_OPTF_FILE value by the file
+ * contents. Two invocations that parse to the same result
+ * get the same key, however their options were spelled or ordered on the
+ * command line. The key is a 64-bit FNV-1a, not a cryptographic digest:
+ * distinct invocations can collide, so compare the stored invocation
+ * before trusting a cache hit when a wrong result is unacceptable.
+ */
+static inline uint64_t
+cmd_hash_invocation(const char *name, const CMD_Opt *opts, int optc,
+		const char *const *pos, int posc)
+{
+	uint64_t h = cmd_hash_field(CMD_HASH_INIT, name, strlen(name));
+
+	for (int i = 0; i < optc; i++) {
+		const CMD_Opt *opt = &opts[i];
+		if (!opt->is_provided) continue;
+
+		h = cmd_hash_u32(h, (uint32_t)i);
+		switch (opt->type) {
+		case CMD_OPT_FLAG: break;
+		case CMD_OPT_INT:
+			h = cmd_hash_u32(h, (uint32_t)opt->int_val);
+			break;
+#ifndef CMD_MINIMAL
+		case CMD_OPT_TIME:
+			h = cmd_hash_u32(h, (uint32_t)opt->time_val);
+			h = cmd_hash_u32(h, (uint32_t)((uint64_t)opt->time_val >> 32));
+			break;
+		case CMD_OPT_CIDR:
+			h = cmd_hash_u32(h, (uint32_t)opt->int_val);
+			/* fallthrough */
+		case CMD_OPT_HEX:
+		case CMD_OPT_B64:
+		case CMD_OPT_IP:
+			h = cmd_hash_field(h, opt->data, opt->len);
+			break;
+#endif
+		default:
+#if defined(CMD_POSIX) && !defined(CMD_MINIMAL)
+			// an "@path" value stands for the file contents
+			if (opt->type == CMD_OPT_STR && (opt->flags & CMD_OPTF_FILE) &&
+			    opt->str_val && opt->str_val[0] == '@') {
+				h = cmd_hash_field(h, opt->data, opt->len);
+				break;
+			}
+#endif
+			if (opt->str_val)
+				h = cmd_hash_field(h, opt->str_val, strlen(opt->str_val));
+			break;
+		}
+	}
+
+	// separate options from positionals: no option has this index
+	h = cmd_hash_u32(h, UINT32_MAX);
+	for (int i = 0; i < posc; i++)
+		h = cmd_hash_field(h, pos[i], strlen(pos[i]));
+	return h;
+}
+
+#ifdef CMD_POSIX
+/* Fold the contents of a file into hash h, e.g. for declared input
+ * paths of a memoized command. Reads through a fixed stack buffer; the
+ * size is folded in after the contents, so that consecutive files
+ * cannot run together.
+ * Returns 1 on success, 0 if the file cannot be read.
+ */
+static inline int
+cmd_hash_file(uint64_t *h, const char *path)
+{
+	unsigned char buf[CMD_IO_BUFSIZE];
+	uint64_t size = 0;
+	ssize_t n;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return 0;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		*h = cmd_hash_bytes(*h, buf, (size_t)n);
+		size += (uint64_t)n;
+	}
+	close(fd);
+	*h = cmd_hash_u32(cmd_hash_u32(*h, (uint32_t)size), (uint32_t)(size >> 32));
+	return n == 0;
+}
+#endif
+
+/* Encode one invocation as a compact binary record, for replay.
+ * Layout (little-endian): u32 record size, u32 argc, u32 stamp low,
+ * u32 stamp high, then argc NUL-terminated strings. stamp is any
+ * caller-chosen 64-bit value, typically a timestamp in nanoseconds.
+ *
+ * Returns:
+ *   Size of the record written to buf, or 0 if it does not fit.
+ */
+static inline size_t
+cmd_record_encode(int argc, char **argv, uint64_t stamp,
+		unsigned char *buf, size_t cap)
+{
+	size_t size = 16;
+
+	for (int i = 0; i < argc; i++)
+		size += strlen(argv[i]) + 1;
+	if (size > cap || size > UINT32_MAX) return 0;
+
+	cmd_put_u32(buf, (uint32_t)size);
+	cmd_put_u32(buf + 4, (uint32_t)argc);
+	cmd_put_u32(buf + 8, (uint32_t)stamp);
+	cmd_put_u32(buf + 12, (uint32_t)(stamp >> 32));
+
+	unsigned char *w = buf + 16;
+	for (int i = 0; i < argc; i++) {
+		size_t len = strlen(argv[i]) + 1;
+		memcpy(w, argv[i], len);
+		w += len;
+	}
+	return size;
+}
+
+/* Decode one record written by cmd_record_encode, without copying:
+ * argv points into buf. argv[*argc] is set to NULL, so maxargs must
+ * exceed the recorded argc.
+ *
+ * Returns:
+ *   Size of the record consumed from buf, or 0 if it is truncated,
+ *   malformed or has too many arguments.
+ */
+static inline size_t
+cmd_record_decode(unsigned char *buf, size_t len, int *argc, char **argv,
+		int maxargs, uint64_t *stamp)
+{
+	if (len < 16) return 0;
+
+	size_t size = cmd_get_u32(buf);
+	uint32_t n = cmd_get_u32(buf + 4);
+	if (size < 16 || size > len || n >= (uint32_t)maxargs) return 0;
+
+	unsigned char *p = buf + 16, *end = buf + size;
+	for (uint32_t i = 0; i < n; i++) {
+		unsigned char *nul = (unsigned char *)memchr(p, '\0', (size_t)(end - p));
+		if (!nul) return 0;
+		argv[i] = (char *)p;
+		p = nul + 1;
+	}
+	if (p != end) return 0;
+
+	argv[n] = NULL;
+	*argc = (int)n;
+	if (stamp)
+		*stamp = cmd_get_u32(buf + 8) | (uint64_t)cmd_get_u32(buf + 12) << 32;
+	return size;
+}
+
+/* Published schema blob format (see cmd_schema_pack) */
+#define CMD_SCHEMA_MAGIC   0x53444d43u /* "CMDS" little-endian */
+#define CMD_SCHEMA_VERSION 1
+#define CMD_SCHEMA_HDR     20 /* magic, version, size, optc, checksum */
+#define CMD_SCHEMA_REC     12 /* lname, help offsets, sname, type, flags, pad */
+#define CMD_SCHEMA_NONE    0xffffffffu /* offset of an absent string */
+
+/* Append a NUL-terminated string to a schema pool, returning its offset */
+static inline uint32_t
+cmd_schema_str(const char *str, unsigned char *buf, size_t cap, size_t *used)
+{
+	if (!str) return CMD_SCHEMA_NONE;
+
+	size_t len = strlen(str) + 1;
+	if (*used > cap || len > cap - *used) {
+		*used = cap + 1; // mark overflow
+		return CMD_SCHEMA_NONE;
+	}
+
+	uint32_t off = (uint32_t)*used;
+	memcpy(buf + *used, str, len);
+	*used += len;
+	return off;
+}
+
+/* Serialize an option schema (names, types, flags, help text) into a
+ * self-contained blob that can be written to a file once and then mapped
+ * read-only by many processes, e.g. with cmd_map_file, instead of every
+ * process rebuilding a large generated schema. The blob starts with a
+ * versioned header and a checksum; strings are stored once in a pool.
+ * Runtime fields (values, buf, cap) are not stored.
+ *
+ * Returns:
+ *   Size of the blob, or 0 if it does not fit in cap bytes.
+ */
+static inline size_t
+cmd_schema_pack(const CMD_Opt *opts, int optc, unsigned char *buf, size_t cap)
+{
+	size_t used = CMD_SCHEMA_HDR + (size_t)optc * CMD_SCHEMA_REC;
+	if (used > cap) return 0;
+
+	for (int i = 0; i < optc; i++) {
+		unsigned char *r = buf + CMD_SCHEMA_HDR + (size_t)i * CMD_SCHEMA_REC;
+		cmd_put_u32(r, cmd_schema_str(opts[i].lname, buf, cap, &used));
+		cmd_put_u32(r + 4, cmd_schema_str(opts[i].help, buf, cap, &used));
+		r[8] = (unsigned char)opts[i].sname;
+		r[9] = (unsigned char)opts[i].type;
+		r[10] = (unsigned char)opts[i].flags;
+		r[11] = 0;
+	}
+	if (used > cap || used > UINT32_MAX) return 0;
+
+	uint64_t h = cmd_hash_bytes(CMD_HASH_INIT, buf + CMD_SCHEMA_HDR,
+		used - CMD_SCHEMA_HDR);
+	cmd_put_u32(buf, CMD_SCHEMA_MAGIC);
+	cmd_put_u32(buf + 4, CMD_SCHEMA_VERSION);
+	cmd_put_u32(buf + 8, (uint32_t)used);
+	cmd_put_u32(buf + 12, (uint32_t)optc);
+	cmd_put_u32(buf + 16, (uint32_t)h);
+	return used;
+}
+
+/* Check a string offset of a schema blob: in the pool and terminated */
+static inline int
+cmd_schema_str_ok(const unsigned char *blob, size_t pool, size_t size,
+		uint32_t off)
+{
+	if (off == CMD_SCHEMA_NONE) return 1;
+	return off >= pool && off < size && memchr(blob + off, '\0', size - off);
+}
+
+/* Load a schema blob written by cmd_schema_pack, e.g. a mapped file.
+ * The header, version, size, checksum and every offset are validated
+ * before use. Option names and help text point into the blob, so nothing
+ * is copied and the blob must stay mapped while opts is in use. Runtime
+ * fields are zeroed; set buf and cap afterwards for binary options.
+ *
+ * Returns:
+ *   Number of options loaded, or -1 if the blob is invalid, from another
+ *   version, or has more than maxopts options.
+ */
+static inline int
+cmd_schema_load(const void *blob, size_t len, CMD_Opt *opts, int maxopts)
+{
+	const unsigned char *b = (const unsigned char *)blob;
+
+	if (len < CMD_SCHEMA_HDR) return -1;
+	if (cmd_get_u32(b) != CMD_SCHEMA_MAGIC ||
+	    cmd_get_u32(b + 4) != CMD_SCHEMA_VERSION)
+		return -1;
+
+	size_t size = cmd_get_u32(b + 8);
+	uint32_t optc = cmd_get_u32(b + 12);
+	if (size > len || optc > (uint32_t)maxopts) return -1;
+
+	size_t pool = CMD_SCHEMA_HDR + (size_t)optc * CMD_SCHEMA_REC;
+	if (pool > size) return -1;
+	if ((uint32_t)cmd_hash_bytes(CMD_HASH_INIT, b + CMD_SCHEMA_HDR,
+	    size - CMD_SCHEMA_HDR) != cmd_get_u32(b + 16))
+		return -1;
+
+	for (uint32_t i = 0; i < optc; i++) {
+		const unsigned char *r = b + CMD_SCHEMA_HDR + (size_t)i * CMD_SCHEMA_REC;
+		uint32_t lname = cmd_get_u32(r), help = cmd_get_u32(r + 4);
+
+		if (!cmd_schema_str_ok(b, pool, size, lname) ||
+		    !cmd_schema_str_ok(b, pool, size, help))
+			return -1;
+
+		// reject types this build does not know
+#ifdef CMD_MINIMAL
+		int known = r[9] <= CMD_OPT_INT;
+#else
+		int known = r[9] <= CMD_OPT_CIDR;
+#endif
+#ifdef CMD_POSIX
+		known |= r[9] == CMD_OPT_PATH;
+#endif
+		if (!known) return -1;
+
+		memset(&opts[i], 0, sizeof(opts[i]));
+		opts[i].lname = lname == CMD_SCHEMA_NONE ? NULL : (const char *)b + lname;
+		opts[i].help = help == CMD_SCHEMA_NONE ? NULL : (const char *)b + help;
+		opts[i].sname = (char)r[8];
+		opts[i].type = (CMD_OptType)r[9];
+		opts[i].flags = r[10];
+	}
+	return (int)optc;
+}
+
+/* Find command by name or alias */
+static inline const CMD_Cmd *
+cmd_find_command(const char *name, const CMD_Cmd *commands)
+{
+	size_t len = strlen(name);
+
+	for (int i = 0; commands[i].name != NULL; i++) {
+		if (cmd_name_matches(commands[i].name, name, len,
+		    commands[i].flags & CMD_CMDF_ICASE)) {
+			return &commands[i];
+		}
+	}
+	return NULL;
+}
+
+/* Run a found command. rargc/rargv is the whole invocation as the
+ * program received it, which is what CMD_RECORD observes.
+ */
+static inline void
+cmd_run_command(const CMD_Cmd *cmd, int argc, char **argv, int rargc,
+		char **rargv)
+{
+#ifdef CMD_RECORD
+	CMD_RECORD(rargc, rargv);
+#else
+	(void)rargc;
+	(void)rargv;
+#endif
+	cmd->fn(argc, argv);
+}
+
+/* Dispatch command based on name.
+ * Define CMD_RECORD(argc, argv) before including to observe every
+ * dispatched invocation, e.g. to append it to a log with
+ * cmd_record_encode; it costs nothing when left undefined.
+ */
+static inline int
+cmd_dispatch(int argc, char **argv, const CMD_Cmd *commands)
+{
+	const CMD_Cmd *cmd = cmd_find_command(argv[1], commands);
+	if (!cmd) return 0;
+
+	cmd_run_command(cmd, argc, argv, argc, argv);
+	return 1;
+}
+
+/* Atomically add d to *p and return the previous value.
+ * Atomic with GCC/Clang builtins and MSVC intrinsics only.
+ */
+static inline int
+cmd_fetch_add(int *p, int d)
+{
+#if defined(__GNUC__)
+	return __atomic_fetch_add(p, d, __ATOMIC_ACQ_REL);
+#elif defined(_MSC_VER)
+	return (int)_InterlockedExchangeAdd((volatile long *)p, d); // long is 32-bit
+#else
+	int old = *p; // not atomic: serialise calls on other compilers
+	*p += d;
+	return old;
+#endif
+}
+
+/* Dispatch like cmd_dispatch, but admit at most commands[i].limit
+ * concurrent runs of each command. inflight holds one counter per entry
+ * of commands, zero-initialised and shared by every dispatching thread.
+ * The counters are only updated atomically with GCC, Clang or MSVC; with
+ * other compilers, serialise calls (e.g. under a mutex) yourself.
+ * A command at its limit is not run, so cheap commands keep flowing
+ * while the caller queues or rejects the excess of expensive ones.
+ *
+ * Returns:
+ *   1 if the command ran, 0 if it was not found, -1 if at its limit.
+ */
+static inline int
+cmd_dispatch_limited(int argc, char **argv, const CMD_Cmd *commands,
+		int *inflight)
+{
+	const CMD_Cmd *cmd = cmd_find_command(argv[1], commands);
+	if (!cmd) return 0;
+
+	int *n = &inflight[cmd - commands];
+	if (cmd->limit > 0 && cmd_fetch_add(n, 1) >= cmd->limit) {
+		cmd_fetch_add(n, -1);
+		return -1;
+	}
+
+	cmd_run_command(cmd, argc, argv, argc, argv);
+	if (cmd->limit > 0) cmd_fetch_add(n, -1);
+	return 1;
+}
+
+/* Record a measured run of a command in a timing history.
+ * hist is a caller-owned table (persist it between batch runs as you
+ * see fit) of *histc entries with room for histcap; a command seen for
+ * the first time is appended if there is room, with its name copied in.
+ * Names longer than CMD_TIMING_NAME_MAX - 1 are not recorded. Durations
+ * and argument counts are smoothed so one outlier does not dominate
+ * estimates.
+ */
+static inline void
+cmd_timing_update(CMD_Timing *hist, int *histc, int histcap,
+		const char *name, int argc, double secs)
+{
+	double args = argc > 2 ? argc - 2 : 0;
+	int i;
+
+	for (i = 0; i < *histc; i++) {
+		if (strcmp(hist[i].name, name) == 0) break;
+	}
+	if (i == *histc) {
+		size_t len = strlen(name);
+		if (*histc == histcap || len >= sizeof(hist[i].name)) return;
+		memcpy(hist[i].name, name, len + 1);
+		hist[i].secs = secs;
+		hist[i].args = args;
+		(*histc)++;
+		return;
+	}
+
+	hist[i].secs += (secs - hist[i].secs) / 4;
+	hist[i].args += (args - hist[i].args) / 4;
+}
+
+/* qsort comparator: longest estimated job first */
+static inline int
+cmd_job_cmp(const void *a, const void *b)
+{
+	double x = ((const CMD_Job *)a)->est, y = ((const CMD_Job *)b)->est;
+	return (x < y) - (x > y);
+}
+
+/* Estimate each job from the timing history and sort the jobs longest
+ * first, so a batch does not end with one long job started last while
+ * the other workers sit idle. A job's estimate scales its command's
+ * smoothed duration by its argument count relative to the history.
+ * Commands without history, and jobs without a command name, get
+ * CMD_JOB_UNKNOWN and run first.
+ */
+static inline void
+cmd_order_jobs(CMD_Job *jobs, int n, const CMD_Timing *hist, int histc)
+{
+	for (int j = 0; j < n; j++) {
+		CMD_Job *job = &jobs[j];
+		double args = job->argc > 2 ? job->argc - 2 : 0;
+		int i;
+
+		job->est = CMD_JOB_UNKNOWN;
+		if (job->argc < 2 || !job->argv[1]) continue; // no command name
+		for (i = 0; i < histc; i++) {
+			if (strcmp(hist[i].name, job->argv[1]) == 0) break;
+		}
+		if (i == histc) continue;
+
+		job->est = hist[i].secs;
+		if (hist[i].args > 0 && args > 0)
+			job->est *= args / hist[i].args;
+	}
+
+	qsort(jobs, n, sizeof(*jobs), cmd_job_cmp);
+}
+
+/* Parse global options placed before the command name,
+ * e.g. `prog --verbose --config=x sub ...`. Options are bound into opts
+ * once, up to the first non-option, which is taken as the command.
+ *
+ * Returns:
+ *   Index of the command name in argv (argc if there is none), with
+ *   *res set to the parse result.
+ */
+static inline int
+cmd_parse_globals(int argc, char **argv, CMD_Opt *opts, int optc,
+		CMD_ParseResult *res)
+{
+	CMD_ParseCtl ctl;
+	int posc;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.mode = CMD_MODE_STOP_AT_POSITIONAL;
+	*res = cmd_parse_core(argc, argv, 1, opts, optc, NULL, 0, &posc, &ctl);
+	return ctl.stop;
+}
+
+/* Dispatch the command at argv[cmdi], as returned by cmd_parse_globals.
+ * The command receives argv shifted so that its argv[1] is the command
+ * name, as with cmd_dispatch; its argv[0] is then the argument just
+ * before the command rather than the program name. Global options stay
+ * in the caller's array for the command to read. CMD_RECORD sees the
+ * unshifted argc/argv, program name and global options included.
+ */
+static inline int
+cmd_dispatch_at(int argc, char **argv, int cmdi, const CMD_Cmd *commands)
+{
+	if (cmdi < 1 || cmdi >= argc) return 0;
+
+	const CMD_Cmd *cmd = cmd_find_command(argv[cmdi], commands);
+	if (!cmd) return 0;
+
+	cmd_run_command(cmd, argc - cmdi + 1, argv + cmdi - 1, argc, argv);
 	return 1;
 }
 
@@ -4,6 +4,10 @@
 
 #include "cmd.h"
 
+CMD_Opt globals[] = {
+	{ .sname = 'v', .lname = "verbose", .type = CMD_OPT_FLAG },
+};
+
 void
 cmd_foo(int argc, char **argv)
 {
@@ -26,6 +30,11 @@ cmd_foo(int argc, char **argv)
 
 	printf("Executing foo command\n");
 
+	// global option, parsed before the command name
+	if (globals[0].is_provided) {
+		printf("Verbose mode enabled\n");
+	}
+
 	// flag
 	if (opts[0].is_provided) {
 		printf("Flag is set!\n");
@@ -53,7 +62,7 @@ cmd_foo(int argc, char **argv)
 void
 cmd_help()
 {
-	printf("Usage: program <command> [options]\n\n");
+	printf("Usage: program [-v|--verbose] <command> [options]\n\n");
 	printf("Commands:\n");
 	printf("  foo   Example command with various options and positionals\n");
 	printf("  help  Show this message\n");
@@ -68,13 +77,15 @@ CMD_Cmd commands[] = {
 int
 main(int argc, char *argv[])
 {
-	if (argc < 2) {
+	CMD_ParseResult res;
+	int cmdi = cmd_parse_globals(argc, argv, globals, 1, &res);
+	if (res != CMD_PARSE_OK || cmdi >= argc) {
 		cmd_help();
 		return 1;
 	}
 
-	if (!cmd_dispatch(argc, argv, commands)) {
-		printf("Unknown command: %s\n", argv[1]);
+	if (!cmd_dispatch_at(argc, argv, cmdi, commands)) {
+		printf("Unknown command: %s\n", argv[cmdi]);
 		cmd_help();
 		return 1;
 	}